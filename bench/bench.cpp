@@ -0,0 +1,408 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+const int DEFAULT_RUNS = 30;
+const double DEFAULT_TOLERANCE = 0.1;
+const size_t LAB2_VOCABULARY_SIZE = 50000;
+const size_t LAB2_OPERATIONS = 200000;
+const size_t LAB2_LONG_KEYS = 20000;
+const size_t LAB2_SNAPSHOT_KEYS = 100000;
+const size_t LAB2_ROUND_TRIPS = 10;
+const size_t LAB4_WORDS = 1000000;
+const size_t LAB4_WORDS_PER_LINE = 12;
+
+// When preload names another workload, every run is paired with a run of
+// the preload right after it and its time is taken off, so only the
+// operations after that common prefix are measured.
+struct TWorkload {
+    std::string name;
+    std::string binary;
+    std::string input;
+    size_t operations;
+    std::string preload;
+};
+
+// Times are per whole run of the binary, not per operation.
+struct TResult {
+    std::string name;
+    size_t operations;
+    double throughput;
+    double min;
+    double median;
+    long rss;
+};
+
+class TZipf {
+private:
+    std::vector<double> cdf;
+
+public:
+    TZipf(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow((double) (i + 1), s);
+            cdf[i] = sum;
+        }
+        for (auto &x: cdf) {
+            x /= sum;
+        }
+    }
+
+    size_t operator()(std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+};
+
+std::string RandomWord(std::mt19937_64 &rng, size_t minSize, size_t maxSize) {
+    size_t size = std::uniform_int_distribution<size_t>(minSize, maxSize)(rng);
+    std::string word(size, 'a');
+    for (auto &c: word) {
+        c = (char) ('a' + rng() % 26);
+    }
+    return word;
+}
+
+// Zipf(1.0) keys, 20% inserts, 10% removes and 70% lookups after a preload.
+size_t GenerateLab2Zipf(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(1);
+    size_t vocabularySize = LAB2_VOCABULARY_SIZE * scale;
+    std::vector<std::string> keys(vocabularySize);
+    for (auto &key: keys) {
+        key = RandomWord(rng, 3, 16);
+    }
+    TZipf zipf(vocabularySize, 1.0);
+    for (size_t i = 0; i < vocabularySize / 2; ++i) {
+        os << "+ " << keys[i] << ' ' << rng() << '\n';
+    }
+    size_t operations = LAB2_OPERATIONS * scale;
+    for (size_t i = 0; i < operations; ++i) {
+        const std::string &key = keys[zipf(rng)];
+        unsigned int kind = rng() % 10;
+        if (kind < 2) {
+            os << "+ " << key << ' ' << rng() << '\n';
+        } else if (kind < 3) {
+            os << "- " << key << '\n';
+        } else {
+            os << key << '\n';
+        }
+    }
+    return vocabularySize / 2 + operations;
+}
+
+// Keys close to the 256 character limit that differ only in their tails.
+size_t GenerateLab2LongKeys(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(2);
+    std::string prefix = RandomWord(rng, 200, 200);
+    size_t count = LAB2_LONG_KEYS * scale;
+    std::vector<std::string> keys(count);
+    for (auto &key: keys) {
+        key = prefix + RandomWord(rng, 1, 56);
+        os << "+ " << key << ' ' << rng() << '\n';
+    }
+    for (auto &key: keys) {
+        os << key << '\n';
+    }
+    return 2 * count;
+}
+
+// The dictionary lab2_save_load starts from.
+size_t GenerateLab2Preload(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(3);
+    size_t count = LAB2_SNAPSHOT_KEYS * scale;
+    for (size_t i = 0; i < count; ++i) {
+        os << "+ " << RandomWord(rng, 3, 24) << ' ' << rng() << '\n';
+    }
+    return count;
+}
+
+// Counts only the Save and Load commands; the preload is measured apart.
+size_t GenerateLab2Snapshot(std::ostream &os, size_t scale, const std::string &snapshot) {
+    GenerateLab2Preload(os, scale);
+    for (size_t i = 0; i < LAB2_ROUND_TRIPS; ++i) {
+        os << "! Save " << snapshot << '\n';
+        os << "! Load " << snapshot << '\n';
+    }
+    return 2 * LAB2_ROUND_TRIPS;
+}
+
+void WriteLab4Text(std::ostream &os, size_t words, std::mt19937_64 &rng, const std::vector<std::string> &vocabulary,
+                   unsigned int oddPercent, const std::string &odd) {
+    for (size_t i = 0; i < words; ++i) {
+        if (oddPercent > 0 && rng() % 100 < oddPercent) {
+            os << odd;
+        } else {
+            os << vocabulary[rng() % vocabulary.size()];
+        }
+        os << ((i + 1) % LAB4_WORDS_PER_LINE == 0 ? '\n' : ' ');
+    }
+    os << '\n';
+}
+
+size_t GenerateLab4Long(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(4);
+    std::vector<std::string> vocabulary(1000);
+    for (auto &word: vocabulary) {
+        word = RandomWord(rng, 1, 10);
+    }
+    os << vocabulary[0] << ' ' << vocabulary[1] << ' ' << vocabulary[2] << '\n';
+    WriteLab4Text(os, LAB4_WORDS * scale, rng, vocabulary, 0, "");
+    return LAB4_WORDS * scale;
+}
+
+// Pattern a^15 b against a text of a with rare b. Every attempt matches
+// fifteen words and fails on the last one, where sp[14] == 14 allows no
+// shift: the worst case for rescanning, not a test of shifts.
+size_t GenerateLab4Periodic(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(5);
+    for (int i = 0; i < 15; ++i) {
+        os << "a ";
+    }
+    os << "b\n";
+    WriteLab4Text(os, LAB4_WORDS * scale, rng, {"a"}, 2, "b");
+    return LAB4_WORDS * scale;
+}
+
+// Pattern a b a b a c against alternating a b with rare c. Mismatches land
+// in the middle of the pattern, where SPFunction borders let KMP skip ahead.
+size_t GenerateLab4Shifts(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(7);
+    os << "a b a b a c\n";
+    size_t words = LAB4_WORDS * scale;
+    for (size_t i = 0; i < words; ++i) {
+        if (rng() % 100 < 2) {
+            os << 'c';
+        } else {
+            os << (i % 2 == 0 ? 'a' : 'b');
+        }
+        os << ((i + 1) % LAB4_WORDS_PER_LINE == 0 ? '\n' : ' ');
+    }
+    os << '\n';
+    return words;
+}
+
+// A one word pattern that matches nine words out of ten.
+size_t GenerateLab4Dense(std::ostream &os, size_t scale) {
+    std::mt19937_64 rng(6);
+    os << "the\n";
+    WriteLab4Text(os, LAB4_WORDS * scale, rng, {"the"}, 10, "cat");
+    return LAB4_WORDS * scale;
+}
+
+// Runs the binary with the input file on stdin and stdout discarded, returns
+// the wall time in milliseconds and the peak RSS in kilobytes.
+bool RunOnce(const TWorkload &workload, double &ms, long &rss) {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        int in = open(workload.input.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0) {
+            _exit(127);
+        }
+        dup2(in, 0);
+        dup2(out, 1);
+        execl(workload.binary.c_str(), workload.binary.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        return false;
+    }
+    ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    rss = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+double Percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t) std::ceil(p * (double) values.size());
+    return values[rank == 0 ? 0 : rank - 1];
+}
+
+bool Measure(const TWorkload &workload, const TWorkload *preload, int runs, TResult &result) {
+    std::vector<double> times;
+    result.name = workload.name;
+    result.operations = workload.operations;
+    result.rss = 0;
+    for (int i = 0; i < runs; ++i) {
+        double ms = 0;
+        long rss = 0;
+        if (!RunOnce(workload, ms, rss)) {
+            std::cerr << workload.name << ": " << workload.binary << " failed\n";
+            return false;
+        }
+        double offset = 0;
+        long preloadRss = 0;
+        if (preload != nullptr && !RunOnce(*preload, offset, preloadRss)) {
+            std::cerr << workload.name << ": " << preload->binary << " failed\n";
+            return false;
+        }
+        times.push_back(std::max(ms - offset, 0.0));
+        result.rss = std::max(result.rss, rss);
+    }
+    result.min = Percentile(times, 0.0);
+    result.median = Percentile(times, 0.5);
+    result.throughput = result.median > 0 ? (double) workload.operations / result.median * 1000.0 : 0.0;
+    return true;
+}
+
+std::map<std::string, TResult> LoadBaseline(const char *fileName) {
+    std::map<std::string, TResult> baseline;
+    std::ifstream ifs(fileName);
+    TResult result;
+    while (ifs >> result.name >> result.operations >> result.throughput >> result.min >> result.median >> result.rss) {
+        baseline[result.name] = result;
+    }
+    return baseline;
+}
+
+void SaveBaseline(const char *fileName, const std::vector<TResult> &results) {
+    std::ofstream ofs(fileName);
+    for (auto &r: results) {
+        ofs << r.name << ' ' << r.operations << ' ' << r.throughput << ' ' << r.min << ' ' << r.median << ' '
+            << r.rss << '\n';
+    }
+}
+
+// Returns the regressions of one result against its baseline entry. A slow
+// run alone is noise; the time regresses only when both the fastest and the
+// median run are slower.
+std::string Compare(const TResult &current, const TResult &base, double tolerance) {
+    std::ostringstream os;
+    if (current.min > base.min * (1 + tolerance) && current.median > base.median * (1 + tolerance)) {
+        os << " time";
+    }
+    if ((double) current.rss > (double) base.rss * (1 + tolerance)) {
+        os << " rss";
+    }
+    return os.str();
+}
+
+// Usage: bench LAB2 LAB4 [--runs R] [--scale S] [--tolerance T]
+//                        [--baseline FILE] [--save-baseline FILE]
+// Generates the workloads into a temporary directory, runs every binary R
+// times and reports the min and median wall time of a whole run, throughput
+// at the median and peak RSS.
+// With --baseline any result worse than the stored one by more than T
+// (a fraction, 0.1 by default) is flagged and the exit status is 1.
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " LAB2 LAB4 [--runs R] [--scale S] [--tolerance T]"
+                  << " [--baseline FILE] [--save-baseline FILE]\n";
+        return 2;
+    }
+    std::string lab2 = argv[1];
+    std::string lab4 = argv[2];
+    int runs = DEFAULT_RUNS;
+    size_t scale = 1;
+    double tolerance = DEFAULT_TOLERANCE;
+    const char *baselineFile = nullptr;
+    const char *saveFile = nullptr;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--runs") == 0) {
+            runs = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--scale") == 0) {
+            scale = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baselineFile = argv[i + 1];
+        } else if (strcmp(argv[i], "--save-baseline") == 0) {
+            saveFile = argv[i + 1];
+        }
+    }
+
+    char dirTemplate[] = "/tmp/da_bench.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        std::cerr << "Cannot create a temporary directory\n";
+        return 2;
+    }
+    std::string dir = dirTemplate;
+    std::vector<TWorkload> workloads;
+    auto add = [&](const std::string &name, const std::string &binary, size_t (*generate)(std::ostream &, size_t)) {
+        std::string input = dir + "/" + name + ".txt";
+        std::ofstream ofs(input);
+        workloads.push_back({name, binary, input, generate(ofs, scale), ""});
+    };
+    add("lab2_zipf_mix", lab2, GenerateLab2Zipf);
+    add("lab2_long_keys", lab2, GenerateLab2LongKeys);
+    add("lab2_preload", lab2, GenerateLab2Preload);
+    {
+        std::string input = dir + "/lab2_save_load.txt";
+        std::ofstream ofs(input);
+        workloads.push_back({"lab2_save_load", lab2, input, GenerateLab2Snapshot(ofs, scale, dir + "/snapshot"),
+                             "lab2_preload"});
+    }
+    add("lab4_long_text", lab4, GenerateLab4Long);
+    add("lab4_periodic", lab4, GenerateLab4Periodic);
+    add("lab4_shifts", lab4, GenerateLab4Shifts);
+    add("lab4_dense", lab4, GenerateLab4Dense);
+
+    std::map<std::string, TResult> baseline;
+    if (baselineFile != nullptr) {
+        baseline = LoadBaseline(baselineFile);
+    }
+    std::vector<TResult> results;
+    int regressions = 0;
+    bool failed = false;
+    printf("%-16s %12s %14s %10s %10s %10s\n", "workload", "ops", "ops/s", "min ms", "median ms", "rss KB");
+    for (auto &workload: workloads) {
+        TResult result;
+        const TWorkload *preload = nullptr;
+        for (auto &other: workloads) {
+            if (other.name == workload.preload) {
+                preload = &other;
+            }
+        }
+        if (!Measure(workload, preload, runs, result)) {
+            failed = true;
+            continue;
+        }
+        results.push_back(result);
+        printf("%-16s %12zu %14.0f %10.2f %10.2f %10ld", result.name.c_str(), result.operations, result.throughput,
+               result.min, result.median, result.rss);
+        auto it = baseline.find(result.name);
+        if (it != baseline.end()) {
+            std::string regressed = Compare(result, it->second, tolerance);
+            if (!regressed.empty()) {
+                ++regressions;
+                printf("  REGRESSION:%s", regressed.c_str());
+            }
+        }
+        printf("\n");
+    }
+
+    for (auto &workload: workloads) {
+        unlink(workload.input.c_str());
+    }
+    unlink((dir + "/snapshot").c_str());
+    rmdir(dir.c_str());
+
+    if (saveFile != nullptr) {
+        SaveBaseline(saveFile, results);
+    }
+    if (failed) {
+        return 2;
+    }
+    return regressions > 0 ? 1 : 0;
+}
@@ -1,9 +1,112 @@
 #include <iostream>
 #include <cstring>
+#include <string>
 
 const int NUMERAL_SYSTEM = 16;
 const int KEY_MAX_SIZE = 33;
 const int STRING_MAX_SIZE = 2049;
+const int STRING_RADIX = 257;
+const size_t INSERTION_SORT_CUTOFF = 16;
+
+#ifdef DA_STATS
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+
+// Phase timers and radix sort counters, enabled with -DDA_STATS. Timers are
+// exclusive as in lab4: a nested one pauses the outer, so parse, sort and
+// output never count the same nanosecond twice. Dumped to stderr at exit or
+// on SIGUSR1 as JSON (DA_STATS_FORMAT=prometheus for the Prometheus text
+// format).
+enum EStat {
+    STAT_PARSE_NS,
+    STAT_SORT_NS,
+    STAT_OUTPUT_NS,
+    STAT_ITEMS,
+    STAT_RADIX_PASSES,
+    STAT_BYTES_MOVED,
+    STAT_ALLOCATIONS,
+    STAT_COUNT
+};
+
+const char *STAT_NAMES[STAT_COUNT] = {
+    "parse_ns",
+    "sort_ns",
+    "output_ns",
+    "items",
+    "radix_passes",
+    "bytes_moved",
+    "allocations"
+};
+
+unsigned long long statValues[STAT_COUNT];
+volatile std::sig_atomic_t statDumpRequested = 0;
+
+void StatDump() {
+    const char *format = getenv("DA_STATS_FORMAT");
+    if (format != nullptr && strcmp(format, "prometheus") == 0) {
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << "# TYPE lab1_" << STAT_NAMES[i] << " counter\n";
+            std::cerr << "lab1_" << STAT_NAMES[i] << ' ' << statValues[i] << '\n';
+        }
+    } else {
+        std::cerr << '{';
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << (i > 0 ? ", " : "") << '"' << STAT_NAMES[i] << "\": " << statValues[i];
+        }
+        std::cerr << "}\n";
+    }
+    std::cerr.flush();
+}
+
+void StatSignal(int) {
+    statDumpRequested = 1;
+}
+
+class TStatTimer {
+private:
+    EStat stat;
+    TStatTimer *outer;
+    std::chrono::steady_clock::time_point start;
+
+    static TStatTimer *current;
+
+    void Stop(std::chrono::steady_clock::time_point now) {
+        statValues[stat] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    }
+
+public:
+    TStatTimer(EStat s) : stat(s), outer(current), start(std::chrono::steady_clock::now()) {
+        if (outer != nullptr) {
+            outer->Stop(start);
+        }
+        current = this;
+    }
+
+    ~TStatTimer() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        Stop(now);
+        current = outer;
+        if (outer != nullptr) {
+            outer->start = now;
+        }
+    }
+};
+
+TStatTimer *TStatTimer::current = nullptr;
+
+#define STAT_ADD(stat, n) (statValues[stat] += (n))
+#define STAT_TIMER(stat) TStatTimer statTimer##stat(stat)
+#define STAT_INIT() std::signal(SIGUSR1, StatSignal)
+#define STAT_POLL() do { if (statDumpRequested) { statDumpRequested = 0; StatDump(); } } while (0)
+#define STAT_DUMP() StatDump()
+#else
+#define STAT_ADD(stat, n) ((void) 0)
+#define STAT_TIMER(stat) ((void) 0)
+#define STAT_INIT() ((void) 0)
+#define STAT_POLL() ((void) 0)
+#define STAT_DUMP() ((void) 0)
+#endif
 
 template <typename T>
 class TVector {
@@ -15,6 +118,7 @@ public:
 
     TVector(size_t initial_size) : size(initial_size), capacity(initial_size) {
         data = new T[capacity];
+        STAT_ADD(STAT_ALLOCATIONS, 1);
     }
 
     ~TVector() {
@@ -37,6 +141,7 @@ public:
         if (size >= capacity) {
             capacity = (capacity == 0) ? 1 : capacity * 2;
             T *newData = new T[capacity];
+            STAT_ADD(STAT_ALLOCATIONS, 1);
             if (data != nullptr) {                
                 for (size_t i = 0; i < size; ++i) {
                     newData[i] = data[i];
@@ -48,6 +153,10 @@ public:
         data[size++] = item;
     }
 
+    T PopBack() {
+        return data[--size];
+    }
+
     T &operator[](size_t index) {
         if (index < size) {
             return data[index];
@@ -71,14 +180,15 @@ public:
 class TString {
 private:
     char *data;
-    short len;
+    size_t len;
 public:
     TString() : data(nullptr), len(0) {}
     
     TString(const char *s) {
         len = strlen(s);
         data = new char[len + 1];
-        for (int i = 0 ; i < len; ++i) {
+        STAT_ADD(STAT_ALLOCATIONS, 1);
+        for (size_t i = 0 ; i < len; ++i) {
             data[i] = s[i];
         }
     }
@@ -87,16 +197,21 @@ public:
         delete[] data;
     }
 
-    short Length() const {
+    size_t Length() const {
         return len;
     }
 
+    const char *Data() const {
+        return data;
+    }
+
     TString &operator=(const TString &other) {
         if (this != &other) {
             delete[] data;
             len = other.len;
             data = new char[len + 1];
-            for (int i = 0; i < len; ++i) {
+            STAT_ADD(STAT_ALLOCATIONS, 1);
+            for (size_t i = 0; i < len; ++i) {
                 data[i] = other.data[i];
             }
         }
@@ -104,7 +219,7 @@ public:
     }
 
     friend std::ostream &operator<<(std::ostream &os, const TString &str) {
-        for (int i = 0; i < str.Length(); ++i) {
+        for (size_t i = 0; i < str.Length(); ++i) {
             os << str.data[i];
         }
         return os;
@@ -126,41 +241,221 @@ struct TItem {
     }
 };
 
+// Stable counting sort of n items by digit(item) in [0, radix). On return
+// count[d] is the position of the first item with digit d in `to`.
+template <typename T, typename TDigit>
+void CountingSort(T *from, T *to, size_t n, int radix, TDigit digit, unsigned int *count) {
+    for (int j = 0; j < radix; ++j) {
+        count[j] = 0;
+    }
+    for (size_t j = 0; j < n; ++j) {
+        ++count[digit(from[j])];
+    }
+    for (int j = 1; j < radix; ++j) {
+        count[j] += count[j - 1];
+    }
+    for (size_t j = n; j > 0; --j) {
+        to[--count[digit(from[j - 1])]] = from[j - 1];
+    }
+    STAT_ADD(STAT_RADIX_PASSES, 1);
+    STAT_ADD(STAT_BYTES_MOVED, n * sizeof(T));
+}
+
+int HexDigit(char c) {
+    return isdigit(c) ? c - '0' : c - 'a' + 10;
+}
+
 void RadixSort(TVector<TItem> &vec) {
-    int count[NUMERAL_SYSTEM];
+    unsigned int count[NUMERAL_SYSTEM];
     size_t size = vec.Size();
     TVector<TItem> output(size);
     for (int i = KEY_MAX_SIZE - 2; i >= 0; --i) {
-        for (int j = 0; j < NUMERAL_SYSTEM; ++j) {
-            count[j] = 0;
-        }
+        CountingSort(vec.Data(), output.Data(), size, NUMERAL_SYSTEM,
+                     [i](const TItem &item) { return HexDigit(item.key[i]); }, count);
         for (size_t j = 0; j < size; ++j) {
-            if (isdigit(vec[j].key[i])) {
-                ++count[vec[j].key[i] - '0'];
-            } else {
-                ++count[vec[j].key[i] - 'a' + 10];
+            vec[j] = output[j];
+        }
+        STAT_ADD(STAT_BYTES_MOVED, size * sizeof(TItem));
+    }
+}
+
+// Variable length key with the payload as an optional second sort column.
+// Both point into strings owned by the caller.
+struct TStringItem {
+    const char *column[2];
+    size_t length[2];
+    size_t value;
+};
+
+// 0 marks the end of the column, so shorter strings go first.
+inline int CharAt(const TStringItem &item, int column, size_t depth) {
+    return depth < item.length[column] ? (unsigned char) item.column[column][depth] + 1 : 0;
+}
+
+int CompareFrom(const TStringItem &lhs, const TStringItem &rhs, int column, size_t depth, bool tieBreak) {
+    for (; column < 2; ++column, depth = 0) {
+        int a, b;
+        do {
+            a = CharAt(lhs, column, depth);
+            b = CharAt(rhs, column, depth);
+            ++depth;
+        } while (a == b && a != 0);
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+        if (!tieBreak) {
+            break;
+        }
+    }
+    return 0;
+}
+
+void InsertionSort(TStringItem *data, size_t n, int column, size_t depth, bool tieBreak) {
+    for (size_t i = 1; i < n; ++i) {
+        TStringItem item = data[i];
+        size_t j = i;
+        while (j > 0 && CompareFrom(data[j - 1], item, column, depth, tieBreak) > 0) {
+            data[j] = data[j - 1];
+            --j;
+        }
+        data[j] = item;
+    }
+}
+
+// A bucket still to be sorted by MSDRadixSort: n items from begin on, by the
+// characters of `column` from `depth` on.
+struct TSortTask {
+    size_t begin;
+    size_t n;
+    int column;
+    size_t depth;
+    bool tieBreak;
+};
+
+// MSD radix sort of the string items. Each level is one stable counting sort;
+// buckets below INSERTION_SORT_CUTOFF are finished by insertion sort. Items
+// whose key ends are ordered by the payload column when tieBreak is set.
+// Pending buckets are kept on an explicit stack, since the number of levels
+// grows with the key length.
+void MSDRadixSort(TStringItem *data, TStringItem *buffer, size_t n, bool tieBreak) {
+    unsigned int count[STRING_RADIX];
+    TVector<TSortTask> tasks;
+    tasks.PushBack({0, n, 0, 0, tieBreak});
+    while (tasks.Size() > 0) {
+        TSortTask task = tasks.PopBack();
+        TStringItem *from = data + task.begin;
+        TStringItem *to = buffer + task.begin;
+        int column = task.column;
+        size_t depth = task.depth;
+        bool finished = false;
+        while (true) {
+            if (task.n <= INSERTION_SORT_CUTOFF) {
+                InsertionSort(from, task.n, column, depth, task.tieBreak);
+                finished = true;
+                break;
+            }
+            CountingSort(from, to, task.n, STRING_RADIX,
+                         [column, depth](const TStringItem &item) { return CharAt(item, column, depth); }, count);
+            int first = CharAt(to[0], column, depth);
+            size_t firstEnd = first + 1 < STRING_RADIX ? count[first + 1] : task.n;
+            if (first == 0 || firstEnd != task.n) {
+                break;
             }
+            // Every key shares this character, the order is unchanged.
+            ++depth;
+        }
+        if (finished) {
+            continue;
         }
-        for (int j = 1; j < NUMERAL_SYSTEM; ++j) {
-            count[j] += count[j - 1];
+        for (size_t j = 0; j < task.n; ++j) {
+            from[j] = to[j];
+        }
+        STAT_ADD(STAT_BYTES_MOVED, task.n * sizeof(TStringItem));
+
+        if (task.tieBreak && count[1] > 1) {
+            tasks.PushBack({task.begin, count[1], 1, 0, false});
         }
-        for (size_t j = size; j > 0; --j) {
-            if (isdigit(vec[j - 1].key[i])) {
-                output[--count[vec[j - 1].key[i] - '0']] = vec[j - 1];
-            } else {
-                output[--count[vec[j - 1].key[i] - 'a' + 10]] = vec[j - 1];
+        for (int b = 1; b < STRING_RADIX; ++b) {
+            size_t end = b + 1 < STRING_RADIX ? count[b + 1] : task.n;
+            if (end - count[b] > 1) {
+                tasks.PushBack({task.begin + count[b], end - count[b], column, depth + 1, task.tieBreak});
             }
         }
-        for (size_t j = 0; j < size; ++j) {
-            vec[j] = output[j];
+    }
+}
+
+void StringRadixSort(TVector<TStringItem> &vec, bool tieBreak) {
+    size_t size = vec.Size();
+    TVector<TStringItem> buffer(size);
+    MSDRadixSort(vec.Data(), buffer.Data(), size, tieBreak);
+}
+
+void SortStringKeys(bool tieBreak) {
+    TVector<TString> keys;
+    TVector<TString> values;
+    TVector<TStringItem> vec;
+    std::string key;
+    std::string value;
+
+    {
+        STAT_TIMER(STAT_PARSE_NS);
+        while (std::cin >> key >> value) {
+            keys.PushBack(key.c_str());
+            values.PushBack(value.c_str());
+            STAT_POLL();
+        }
+        // Items point into the strings, so they are made once both vectors
+        // have stopped growing.
+        for (size_t i = 0; i < keys.Size(); ++i) {
+            TStringItem item;
+            item.column[0] = keys[i].Data();
+            item.length[0] = keys[i].Length();
+            item.column[1] = values[i].Data();
+            item.length[1] = values[i].Length();
+            item.value = i;
+            vec.PushBack(item);
+        }
+        STAT_ADD(STAT_ITEMS, vec.Size());
+    }
+
+    {
+        STAT_TIMER(STAT_SORT_NS);
+        StringRadixSort(vec, tieBreak);
+    }
+
+    {
+        STAT_TIMER(STAT_OUTPUT_NS);
+        for (size_t i = 0; i < vec.Size(); ++i) {
+            std::cout << keys[vec[i].value] << '\t' << values[vec[i].value] << '\n';
         }
+        std::cout.flush();
     }
 }
 
-int main() {
+// Usage: lab1 [-s] [-t]
+// By default keys are 32 hex digits. -s accepts keys of any length and
+// sorts them bytewise, -t (implies -s) orders equal keys by their value.
+int main(int argc, char *argv[]) {
     std::ios::sync_with_stdio(false);
     std::cin.tie(0);
     std::cout.tie(0);
+    STAT_INIT();
+
+    bool stringKeys = false;
+    bool tieBreak = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0) {
+            stringKeys = true;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            stringKeys = true;
+            tieBreak = true;
+        }
+    }
+    if (stringKeys) {
+        SortStringKeys(tieBreak);
+        STAT_DUMP();
+        return 0;
+    }
 
     TVector<TItem> vec;
     TItem item;
@@ -170,19 +465,32 @@ int main() {
 
     // Input vector
     size_t num = 0;
-    while (std::cin >> item.key) {
-        std::cin >> str;
-        strv.PushBack(str);
-        item.value = num;
-        ++num;
-        vec.PushBack(item);
+    {
+        STAT_TIMER(STAT_PARSE_NS);
+        while (std::cin >> item.key) {
+            std::cin >> str;
+            strv.PushBack(str);
+            item.value = num;
+            ++num;
+            vec.PushBack(item);
+            STAT_POLL();
+        }
+        STAT_ADD(STAT_ITEMS, num);
     }
 
     // Radix sort
-    RadixSort(vec);
+    {
+        STAT_TIMER(STAT_SORT_NS);
+        RadixSort(vec);
+    }
 
     // Output vector
-    for (int i = 0; i < vec.Size(); ++i) {
-        std::cout << vec[i].key << '\t' << strv[vec[i].value] << '\n'; 
+    {
+        STAT_TIMER(STAT_OUTPUT_NS);
+        for (int i = 0; i < vec.Size(); ++i) {
+            std::cout << vec[i].key << '\t' << strv[vec[i].value] << '\n'; 
+        }
+        std::cout.flush();
     }
+    STAT_DUMP();
 }
\ No newline at end of file
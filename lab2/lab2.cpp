@@ -1,7 +1,195 @@
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 const size_t KEY_MAX_SIZE = 257;
+const size_t READ_CHUNK_SIZE = 1 << 16;
+const size_t SNAPSHOT_BLOCK_SIZE = 16;
+const char SNAPSHOT_MAGIC[4] = {'A', 'V', 'L', 'S'};
+const int SERVER_BACKLOG = 128;
+const int MAX_EVENTS = 64;
+const unsigned long long LISTEN_EVENT_ID = 0;
+const unsigned long long COMPLETION_EVENT_ID = 1;
+const size_t CACHE_WAYS = 8;
+
+#ifdef DA_STATS
+#include <atomic>
+#include <chrono>
+
+// Per-operation timers and AVL tree counters (-DDA_STATS). Rotations per
+// insert and comparisons per descent follow from the raw totals. Timers are
+// exclusive per thread, the same as lab4's phases. Every thread counts into
+// its own block and the blocks are summed when the values are printed: to
+// stderr at exit or on SIGUSR1, as JSON or Prometheus text
+// (DA_STATS_FORMAT=prometheus).
+enum EStat {
+    STAT_PARSE_NS,
+    STAT_INSERT_NS,
+    STAT_REMOVE_NS,
+    STAT_FIND_NS,
+    STAT_SAVE_NS,
+    STAT_LOAD_NS,
+    STAT_COMMANDS,
+    STAT_INSERTS,
+    STAT_REMOVES,
+    STAT_LOOKUPS,
+    STAT_DESCENTS,
+    STAT_DESCENT_COMPARISONS,
+    STAT_ROTATIONS,
+    STAT_NODE_ALLOCATIONS,
+    STAT_NODES_SAVED,
+    STAT_NODES_LOADED,
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_CACHE_EVICTIONS,
+    STAT_COUNT
+};
+
+const char *STAT_NAMES[STAT_COUNT] = {
+    "parse_ns",
+    "insert_ns",
+    "remove_ns",
+    "find_ns",
+    "save_ns",
+    "load_ns",
+    "commands",
+    "inserts",
+    "removes",
+    "lookups",
+    "descents",
+    "descent_comparisons",
+    "rotations",
+    "node_allocations",
+    "nodes_saved",
+    "nodes_loaded",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions"
+};
+
+// Written only by its own thread; atomic so that StatDump may read it.
+struct TStatBlock {
+    std::atomic<unsigned long long> values[STAT_COUNT];
+
+    TStatBlock() {
+        for (auto &value: values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Blocks outlive their threads, so the counts of stopped shards are kept.
+std::mutex statMutex;
+std::vector<std::unique_ptr<TStatBlock>> statBlocks;
+volatile std::sig_atomic_t statDumpRequested = 0;
+
+TStatBlock &LocalStats() {
+    thread_local TStatBlock *block = nullptr;
+    if (block == nullptr) {
+        std::lock_guard<std::mutex> lock(statMutex);
+        statBlocks.emplace_back(new TStatBlock());
+        block = statBlocks.back().get();
+    }
+    return *block;
+}
+
+void StatAdd(EStat stat, unsigned long long n) {
+    std::atomic<unsigned long long> &value = LocalStats().values[stat];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void StatDump() {
+    unsigned long long totals[STAT_COUNT] = {};
+    {
+        std::lock_guard<std::mutex> lock(statMutex);
+        for (auto &block: statBlocks) {
+            for (int i = 0; i < STAT_COUNT; ++i) {
+                totals[i] += block->values[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    const char *format = getenv("DA_STATS_FORMAT");
+    if (format != nullptr && strcmp(format, "prometheus") == 0) {
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << "# TYPE lab2_" << STAT_NAMES[i] << " counter\n";
+            std::cerr << "lab2_" << STAT_NAMES[i] << ' ' << totals[i] << '\n';
+        }
+    } else {
+        std::cerr << '{';
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << (i > 0 ? ", " : "") << '"' << STAT_NAMES[i] << "\": " << totals[i];
+        }
+        std::cerr << "}\n";
+    }
+    std::cerr.flush();
+}
+
+void StatSignal(int) {
+    statDumpRequested = 1;
+}
+
+class TStatTimer {
+private:
+    EStat stat;
+    TStatTimer *outer;
+    std::chrono::steady_clock::time_point start;
+
+    static thread_local TStatTimer *current;
+
+    void Stop(std::chrono::steady_clock::time_point now) {
+        StatAdd(stat, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+    }
+
+public:
+    TStatTimer(EStat s) : stat(s), outer(current), start(std::chrono::steady_clock::now()) {
+        if (outer != nullptr) {
+            outer->Stop(start);
+        }
+        current = this;
+    }
+
+    ~TStatTimer() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        Stop(now);
+        current = outer;
+        if (outer != nullptr) {
+            outer->start = now;
+        }
+    }
+};
+
+thread_local TStatTimer *TStatTimer::current = nullptr;
+
+#define STAT_ADD(stat, n) StatAdd(stat, n)
+#define STAT_TIMER(stat) TStatTimer statTimer##stat(stat)
+#define STAT_INIT() std::signal(SIGUSR1, StatSignal)
+#define STAT_POLL() do { if (statDumpRequested) { statDumpRequested = 0; StatDump(); } } while (0)
+#define STAT_DUMP() StatDump()
+#else
+#define STAT_ADD(stat, n) ((void) 0)
+#define STAT_TIMER(stat) ((void) 0)
+#define STAT_INIT() ((void) 0)
+#define STAT_POLL() ((void) 0)
+#define STAT_DUMP() ((void) 0)
+#endif
 
 class TString {
 private:
@@ -33,7 +221,9 @@ public:
         char c;
         while (is.get(c) && (c == ' ' || c == '\n')) {}
         while (c != ' ' && c != '\n') {
-            str.PushBack(c);
+            if (str.size < KEY_MAX_SIZE - 1) {
+                str.PushBack(c);
+            }
             is.get(c);
         }
         return is;
@@ -201,6 +391,7 @@ private:
             value = val;
             left = right = nullptr;
             height = 1;
+            STAT_ADD(STAT_NODE_ALLOCATIONS, 1);
         }
     };
     TNode *root;
@@ -237,6 +428,7 @@ private:
     }
 
     TNode *RightRotate(TNode *tree) {
+        STAT_ADD(STAT_ROTATIONS, 1);
         TNode *tmp = tree->left;
         tree->left = tmp->right;
         tmp->right = tree;
@@ -246,6 +438,7 @@ private:
     }
 
     TNode *LeftRotate(TNode *tree) {
+        STAT_ADD(STAT_ROTATIONS, 1);
         TNode *tmp = tree->right;
         tree->right = tmp->left;
         tmp->left = tree;
@@ -271,7 +464,9 @@ private:
     }
 
     TNode *FindTree(TNode *tree, const KeyType &k) {
+        STAT_ADD(STAT_DESCENTS, 1);
         while (tree != nullptr) {
+            STAT_ADD(STAT_DESCENT_COMPARISONS, 1);
             if (k > tree->key) {
                 tree = tree->right;
             } else if (k < tree->key) {
@@ -342,28 +537,176 @@ private:
         delete tree;
     }
 
-    void Serialize(TNode *tree, std::ofstream &ofs) {
+    // Snapshot layout: magic, varint count, block size and number of parts
+    // (1, or the shard count when a server writes one file per shard), then
+    // the keys in order as (shared prefix, suffix length, suffix, value)
+    // varint records.
+    // Every block starts with a full key (shared prefix 0). A sparse index of
+    // (block offset, first key) and the 8-byte offset of that index close the
+    // file; the loader itself only streams through the records.
+    struct TSnapshotWriter {
+        std::ofstream &ofs;
+        size_t written;
+        size_t inBlock;
+        char last[KEY_MAX_SIZE];
+        size_t lastSize;
+        std::vector<std::pair<size_t, KeyType>> index;
+
+        TSnapshotWriter(std::ofstream &os) : ofs(os), written(0), inBlock(0), lastSize(0) {}
+
+        void WriteBytes(const char *data, size_t size) {
+            ofs.write(data, (std::streamsize) size);
+            written += size;
+        }
+
+        void WriteVarint(unsigned long long x) {
+            char buffer[10];
+            size_t size = 0;
+            while (x >= 0x80) {
+                buffer[size++] = (char) ((x & 0x7F) | 0x80);
+                x >>= 7;
+            }
+            buffer[size++] = (char) x;
+            WriteBytes(buffer, size);
+        }
+    };
+
+    size_t Count(TNode *tree) {
+        return tree == nullptr ? 0 : Count(tree->left) + Count(tree->right) + 1;
+    }
+
+    void Serialize(TNode *tree, TSnapshotWriter &writer) {
         if (tree == nullptr) {
             return;
         }
+        Serialize(tree->left, writer);
 
+        STAT_ADD(STAT_NODES_SAVED, 1);
+        const char *key = tree->key.GetData();
         size_t size = tree->key.Size();
-        ofs.write(reinterpret_cast<char *>(&size), sizeof(size_t));
-        ofs.write(tree->key.GetData(), size);
-        ofs.write((char*) &tree->value, sizeof(ValueType));
+        size_t shared = 0;
+        if (writer.inBlock == SNAPSHOT_BLOCK_SIZE) {
+            writer.inBlock = 0;
+        }
+        if (writer.inBlock == 0) {
+            writer.index.emplace_back(writer.written, tree->key);
+        } else {
+            while (shared < size && shared < writer.lastSize && key[shared] == writer.last[shared]) {
+                ++shared;
+            }
+        }
+        writer.WriteVarint(shared);
+        writer.WriteVarint(size - shared);
+        writer.WriteBytes(key + shared, size - shared);
+        writer.WriteVarint((unsigned long long) tree->value);
+        for (size_t i = shared; i < size; ++i) {
+            writer.last[i] = key[i];
+        }
+        writer.lastSize = size;
+        ++writer.inBlock;
+
+        Serialize(tree->right, writer);
+    }
+
+    // Streams the records of a snapshot. Any short read, oversized key or key
+    // that does not sort after the previous one marks the reader as failed.
+    struct TSnapshotReader {
+        std::streambuf *buf;
+        char key[KEY_MAX_SIZE];
+        size_t size;
+        bool first;
+        bool failed;
+
+        TSnapshotReader(std::streambuf *b) : buf(b), size(0), first(true), failed(false) {
+            key[0] = '\0';
+        }
+
+        unsigned long long ReadVarint() {
+            unsigned long long x = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                int c = buf->sbumpc();
+                if (c == EOF) {
+                    failed = true;
+                    return 0;
+                }
+                x |= (unsigned long long) (c & 0x7F) << shift;
+                if ((c & 0x80) == 0) {
+                    return x;
+                }
+            }
+            failed = true;
+            return 0;
+        }
 
-        bool left = (tree->left != nullptr);
-        bool right = (tree->right != nullptr);
-        ofs.write(reinterpret_cast<char *>(&left), sizeof(bool));
-        ofs.write(reinterpret_cast<char *>(&right), sizeof(bool));
-        
-        if (left) Serialize(tree->left, ofs);
-        if (right) Serialize(tree->right, ofs);
+        bool Next(ValueType &value) {
+            size_t shared = ReadVarint();
+            size_t suffixSize = ReadVarint();
+            if (failed || shared > size || suffixSize > KEY_MAX_SIZE - 1 - shared) {
+                failed = true;
+                return false;
+            }
+            char suffix[KEY_MAX_SIZE];
+            if ((size_t) buf->sgetn(suffix, (std::streamsize) suffixSize) != suffixSize) {
+                failed = true;
+                return false;
+            }
+            if (!first) {
+                size_t i = 0;
+                while (i < suffixSize && shared + i < size && suffix[i] == key[shared + i]) {
+                    ++i;
+                }
+                bool greater = i < suffixSize && (shared + i == size || suffix[i] > key[shared + i]);
+                if (!greater) {
+                    failed = true;
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < suffixSize; ++i) {
+                key[shared + i] = suffix[i];
+            }
+            size = shared + suffixSize;
+            key[size] = '\0';
+            value = (ValueType) ReadVarint();
+            first = false;
+            return !failed;
+        }
+    };
+
+    // Builds a perfectly balanced tree from the next n records, which come in
+    // key order, so no rotations are needed. Returns nullptr on a bad read.
+    TNode *Deserialize(TSnapshotReader &reader, size_t n) {
+        if (n == 0) {
+            return nullptr;
+        }
+        size_t leftSize = (n - 1) / 2;
+        TNode *left = Deserialize(reader, leftSize);
+        ValueType val = 0;
+        if (reader.failed || !reader.Next(val)) {
+            DeleteTree(left);
+            return nullptr;
+        }
+
+        STAT_ADD(STAT_NODES_LOADED, 1);
+        TNode *newNode = new TNode(reader.key, val);
+        newNode->left = left;
+        newNode->right = Deserialize(reader, n - 1 - leftSize);
+        if (reader.failed) {
+            DeleteTree(newNode);
+            return nullptr;
+        }
+        FixHeight(newNode);
+        return newNode;
     }
 
-    TNode *Deserialize(std::ifstream &ifs) {
+    // Reads the preorder format written before snapshots were front coded.
+    TNode *DeserializeLegacy(std::ifstream &ifs) {
+        STAT_ADD(STAT_NODES_LOADED, 1);
         size_t size = 0;
         ifs.read(reinterpret_cast<char *>(&size), sizeof(size_t));
+        if (!ifs || size >= KEY_MAX_SIZE) {
+            ifs.setstate(std::ios::failbit);
+            return nullptr;
+        }
 
         char *key = new char[size + 1];
         key[size] = '\0';
@@ -381,19 +724,136 @@ private:
         ifs.read((char*) &left, sizeof(bool));
         ifs.read((char*) &right, sizeof(bool));
 
-        if (left) newNode->left = Deserialize(ifs);
-        if (right) newNode->right = Deserialize(ifs);
+        if (left && ifs) newNode->left = DeserializeLegacy(ifs);
+        if (right && ifs) newNode->right = DeserializeLegacy(ifs);
         return newNode;
     }
 
+    // The records must end exactly where the footer says the index starts.
+    static bool CheckFooter(std::ifstream &is) {
+        std::streamoff end = is.tellg();
+        char footer[8];
+        if (end < 0 || !is.seekg(-(std::streamoff) sizeof(footer), std::ios::end) ||
+            !is.read(footer, sizeof(footer))) {
+            return false;
+        }
+        unsigned long long indexOffset = 0;
+        for (int i = 0; i < 8; ++i) {
+            indexOffset |= (unsigned long long) (unsigned char) footer[i] << (8 * i);
+        }
+        return indexOffset == (unsigned long long) end;
+    }
+
+    // Builds the tree of a single-part or legacy snapshot into loaded. On
+    // failure loaded stays nullptr.
+    bool ReadSnapshot(std::ifstream &is, TNode *&loaded) {
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        if (!is.read(magic, sizeof(magic))) {
+            return false;
+        }
+        TNode *tree = nullptr;
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+            is.seekg(0);
+            tree = DeserializeLegacy(is);
+            if (!is) {
+                DeleteTree(tree);
+                return false;
+            }
+            loaded = tree;
+            return true;
+        }
+        TSnapshotReader reader(is.rdbuf());
+        size_t count = reader.ReadVarint();
+        reader.ReadVarint();
+        size_t parts = reader.ReadVarint();
+        if (!reader.failed && parts == 1) {
+            tree = Deserialize(reader, count);
+        } else {
+            reader.failed = true;
+        }
+        if (reader.failed || !CheckFooter(is)) {
+            DeleteTree(tree);
+            return false;
+        }
+        loaded = tree;
+        return true;
+    }
+
+    // The legacy Save wrote nothing for an empty dictionary.
+    static bool EmptyFile(std::ifstream &is) {
+        return is.is_open() && is.peek() == EOF;
+    }
+
 public:
-    void Load(std::ifstream &is) {
+    // Returns false and leaves the tree unchanged if the file is missing,
+    // truncated or corrupt.
+    bool Load(std::ifstream &is) {
+        TNode *loaded = nullptr;
+        if (!EmptyFile(is) && !ReadSnapshot(is, loaded)) {
+            return false;
+        }
         DeleteTree(root);
-        root = Deserialize(is);
+        root = loaded;
+        return true;
+    }
+
+    // Inserts the keys of one snapshot part that pass keep and reports how
+    // many parts the snapshot has. Returns false on a bad or legacy file, or
+    // on a key that is already in the tree.
+    template <typename TKeep>
+    bool Merge(std::ifstream &is, size_t &parts, TKeep keep) {
+        if (EmptyFile(is)) {
+            parts = 1;
+            return true;
+        }
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        if (!is.read(magic, sizeof(magic)) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+            return false;
+        }
+        TSnapshotReader reader(is.rdbuf());
+        size_t count = reader.ReadVarint();
+        reader.ReadVarint();
+        parts = reader.ReadVarint();
+        ValueType val = 0;
+        for (size_t i = 0; i < count && !reader.failed; ++i) {
+            if (!reader.Next(val)) {
+                break;
+            }
+            KeyType key(reader.key);
+            if (keep(key)) {
+                STAT_ADD(STAT_NODES_LOADED, 1);
+                if (!Insert(key, val)) {
+                    return false;
+                }
+            }
+        }
+        return !reader.failed && CheckFooter(is);
     }
 
-    void Save(std::ofstream &ofs) {
-        Serialize(root, ofs);
+    void Swap(TAVLTree &other) {
+        std::swap(root, other.root);
+    }
+
+    void Save(std::ofstream &ofs, size_t parts = 1) {
+        TSnapshotWriter writer(ofs);
+        writer.WriteBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        writer.WriteVarint(Count(root));
+        writer.WriteVarint(SNAPSHOT_BLOCK_SIZE);
+        writer.WriteVarint(parts);
+        Serialize(root, writer);
+
+        unsigned long long indexOffset = writer.written;
+        writer.WriteVarint(writer.index.size());
+        for (auto &entry: writer.index) {
+            writer.WriteVarint(entry.first);
+            writer.WriteVarint(entry.second.Size());
+            writer.WriteBytes(entry.second.GetData(), entry.second.Size());
+        }
+        char footer[8];
+        for (int i = 0; i < 8; ++i) {
+            footer[i] = (char) ((indexOffset >> (8 * i)) & 0xFF);
+        }
+        writer.WriteBytes(footer, sizeof(footer));
     }
 
     ValueType *Find(const KeyType &k) {
@@ -443,26 +903,741 @@ void ToLower(TString &str) {
     }
 }
 
-int main() {
+size_t HashKey(const TString &key) {
+    size_t hash = 14695981039346656037ull;
+    const char *data = key.GetData();
+    for (size_t i = 0; i < key.Size(); ++i) {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct TCacheConfig {
+    size_t size;
+    bool secondHit;
+};
+
+// Open-addressing cache of hot keys. A key hashes to a group of CACHE_WAYS
+// neighbouring slots; a full group evicts its least used slot. Values are
+// copied rather than pointing at tree nodes, since RemoveNode reallocates the
+// successor node. With secondHit a key is admitted only when a doorkeeper
+// bitmap has already seen it, which keeps one-off lookups out.
+template <typename KeyType, typename ValueType>
+class THotKeyCache {
+private:
+    struct TSlot {
+        size_t hash;
+        KeyType key;
+        ValueType value;
+        unsigned char hits;
+        bool used;
+    };
+
+    std::vector<TSlot> slots;
+    std::vector<unsigned long long> doorkeeper;
+    int shift;
+    size_t attempts;
+    bool secondHit;
+
+    size_t Group(size_t hash) const {
+        return (size_t) ((hash * 0x9E3779B97F4A7C15ull) >> shift) & ~(size_t) (CACHE_WAYS - 1);
+    }
+
+    bool Seen(size_t hash) {
+        if (++attempts > doorkeeper.size() * 64) {
+            std::fill(doorkeeper.begin(), doorkeeper.end(), 0);
+            attempts = 0;
+        }
+        size_t bit = (hash >> 7) % (doorkeeper.size() * 64);
+        bool seen = (doorkeeper[bit / 64] >> (bit % 64)) & 1;
+        doorkeeper[bit / 64] |= 1ull << (bit % 64);
+        return seen;
+    }
+
+public:
+    THotKeyCache(const TCacheConfig &config) : shift(64), attempts(0), secondHit(config.secondHit) {
+        if (config.size == 0) {
+            return;
+        }
+        size_t size = CACHE_WAYS;
+        shift = 64 - __builtin_ctzll(CACHE_WAYS);
+        while (size < config.size) {
+            size <<= 1;
+            --shift;
+        }
+        slots.resize(size);
+        for (auto &slot: slots) {
+            slot.used = false;
+        }
+        doorkeeper.assign(size / 16 + 1, 0);
+    }
+
+    bool Enabled() const {
+        return !slots.empty();
+    }
+
+    ValueType *Find(const KeyType &key, size_t hash) {
+        TSlot *group = &slots[Group(hash)];
+        for (size_t i = 0; i < CACHE_WAYS; ++i) {
+            if (group[i].used && group[i].hash == hash && group[i].key == key.GetData()) {
+                if (group[i].hits < 255) {
+                    ++group[i].hits;
+                }
+                STAT_ADD(STAT_CACHE_HITS, 1);
+                return &group[i].value;
+            }
+        }
+        STAT_ADD(STAT_CACHE_MISSES, 1);
+        return nullptr;
+    }
+
+    void Admit(const KeyType &key, size_t hash, const ValueType &value) {
+        if (secondHit && !Seen(hash)) {
+            return;
+        }
+        TSlot *group = &slots[Group(hash)];
+        TSlot *victim = &group[0];
+        for (size_t i = 0; i < CACHE_WAYS && victim->used; ++i) {
+            if (!group[i].used || group[i].hits < victim->hits) {
+                victim = &group[i];
+            }
+        }
+        if (victim->used) {
+            STAT_ADD(STAT_CACHE_EVICTIONS, 1);
+            for (size_t i = 0; i < CACHE_WAYS; ++i) {
+                group[i].hits >>= 1;
+            }
+        }
+        victim->hash = hash;
+        victim->key = key;
+        victim->value = value;
+        victim->hits = 0;
+        victim->used = true;
+    }
+
+    void Erase(const KeyType &key, size_t hash) {
+        TSlot *group = &slots[Group(hash)];
+        for (size_t i = 0; i < CACHE_WAYS; ++i) {
+            if (group[i].used && group[i].hash == hash && group[i].key == key.GetData()) {
+                group[i].used = false;
+            }
+        }
+    }
+
+    void Clear() {
+        for (auto &slot: slots) {
+            slot.used = false;
+        }
+    }
+};
+
+// TAVLTree with an optional hot-key cache in front of point lookups. The
+// cache only holds keys present in the tree: Remove erases the key and Load
+// drops everything, Insert never changes an existing value.
+class TDictionary {
+public:
+    typedef TAVLTree<TString, unsigned long long> TTree;
+
+private:
+    TTree tree;
+    THotKeyCache<TString, unsigned long long> cache;
+
+public:
+    TDictionary(const TCacheConfig &config) : cache(config) {}
+
+    int Insert(const TString &key, unsigned long long value) {
+        return tree.Insert(key, value);
+    }
+
+    int Remove(const TString &key) {
+        if (!tree.Remove(key)) {
+            return 0;
+        }
+        if (cache.Enabled()) {
+            cache.Erase(key, HashKey(key));
+        }
+        return 1;
+    }
+
+    unsigned long long *Find(const TString &key) {
+        if (!cache.Enabled()) {
+            return tree.Find(key);
+        }
+        size_t hash = HashKey(key);
+        unsigned long long *value = cache.Find(key, hash);
+        if (value == nullptr) {
+            value = tree.Find(key);
+            if (value != nullptr) {
+                cache.Admit(key, hash, *value);
+            }
+        }
+        return value;
+    }
+
+    // Reads FILE, or if it does not exist the parts FILE.0 .. FILE.<n-1> of a
+    // server snapshot, into loaded, keeping only the keys that belong to this
+    // shard. The parts are rehashed, so the shard count may differ from the
+    // one used for Save. The dictionary itself is not touched.
+    static bool Read(const std::string &fileName, size_t shard, size_t shards, TTree &loaded) {
+        std::ifstream single(fileName, std::ios::binary | std::ios::in);
+        if (single && shards == 1) {
+            return loaded.Load(single);
+        }
+        auto keep = [shard, shards](const TString &key) {
+            return HashKey(key) % shards == shard;
+        };
+        size_t parts = 1;
+        for (size_t p = 0; p < parts; ++p) {
+            std::string name = single ? fileName : fileName + "." + std::to_string(p);
+            std::ifstream ifs(name, std::ios::binary | std::ios::in);
+            size_t partParts = 0;
+            if (!loaded.Merge(ifs, partParts, keep) || (p == 0 ? (single && partParts != 1) : partParts != parts)) {
+                return false;
+            }
+            parts = partParts;
+        }
+        return true;
+    }
+
+    void Replace(TTree &loaded) {
+        cache.Clear();
+        tree.Swap(loaded);
+    }
+
+    // A failed Load leaves the dictionary unchanged.
+    bool Load(const std::string &fileName, size_t shard, size_t shards) {
+        TTree loaded;
+        if (!Read(fileName, shard, shards, loaded)) {
+            return false;
+        }
+        Replace(loaded);
+        return true;
+    }
+
+    void Save(std::ofstream &ofs, size_t parts = 1) {
+        tree.Save(ofs, parts);
+    }
+};
+
+// Meeting point of all shards for one Save or Load. Every shard waits in
+// Arrive until the others got there and learns whether all of them succeeded.
+class TBarrier {
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t missing;
+    bool ok;
+
+public:
+    TBarrier(size_t count) : missing(count), ok(true) {}
+
+    bool Arrive(bool success) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ok = ok && success;
+        if (--missing == 0) {
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [this] { return missing == 0; });
+        }
+        return ok;
+    }
+};
+
+struct TRequest {
+    unsigned long long connection;
+    unsigned long long seq;
+    char type;
+    TString key;
+    unsigned long long value;
+    std::string fileName;
+    std::shared_ptr<TBarrier> barrier;
+};
+
+struct TResponse {
+    unsigned long long connection;
+    unsigned long long seq;
+    std::string text;
+};
+
+// Responses from the workers, handed to the event loop through an eventfd.
+class TCompletionQueue {
+private:
+    std::mutex mutex;
+    std::vector<TResponse> responses;
+    int eventFd;
+
+public:
+    TCompletionQueue() : eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    ~TCompletionQueue() {
+        close(eventFd);
+    }
+
+    int Fd() const {
+        return eventFd;
+    }
+
+    void Push(TResponse &&response) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            responses.emplace_back(std::move(response));
+        }
+        uint64_t one = 1;
+        ssize_t written = write(eventFd, &one, sizeof(one));
+        (void) written;
+    }
+
+    void Drain(std::vector<TResponse> &out) {
+        uint64_t count = 0;
+        ssize_t got = read(eventFd, &count, sizeof(count));
+        (void) got;
+        std::lock_guard<std::mutex> lock(mutex);
+        out.swap(responses);
+    }
+};
+
+// One part of the keyspace. The tree is touched only by the shard's own
+// worker thread, requests reach it through a locked queue. Save and Load
+// end in a barrier, so no shard reads a part before every shard has
+// written it, and a Load is applied by all shards or by none.
+class TShard {
+private:
+    TDictionary tree;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<TRequest> queue;
+    bool stopping;
+    size_t index;
+    size_t shardCount;
+    TCompletionQueue &completions;
+    std::thread worker;
+
+    std::string Execute(const TRequest &request) {
+        if (request.type == '+') {
+            return tree.Insert(request.key, request.value) ? "OK\n" : "Exist\n";
+        } else if (request.type == '-') {
+            return tree.Remove(request.key) ? "OK\n" : "NoSuchWord\n";
+        } else if (request.type == 'S') {
+            {
+                std::ofstream ofs(request.fileName + "." + std::to_string(index), std::ios::binary | std::ios::out);
+                tree.Save(ofs, shardCount);
+            }
+            // A single-file snapshot of the same name would shadow the parts.
+            if (index == 0) {
+                unlink(request.fileName.c_str());
+            }
+            request.barrier->Arrive(true);
+            return "OK\n";
+        } else if (request.type == 'L') {
+            TDictionary::TTree loaded;
+            bool read = TDictionary::Read(request.fileName, index, shardCount, loaded);
+            if (!request.barrier->Arrive(read)) {
+                return "LoadError\n";
+            }
+            tree.Replace(loaded);
+            return "OK\n";
+        }
+        unsigned long long *value = tree.Find(request.key);
+        if (value == nullptr) {
+            return "NoSuchWord\n";
+        }
+        return "OK: " + std::to_string(*value) + "\n";
+    }
+
+    void Run() {
+        while (true) {
+            TRequest request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                request = std::move(queue.front());
+                queue.pop_front();
+            }
+            completions.Push({request.connection, request.seq, Execute(request)});
+        }
+    }
+
+public:
+    TShard(size_t i, size_t count, TCompletionQueue &queue, const TCacheConfig &config)
+            : tree(config), stopping(false), index(i), shardCount(count), completions(queue),
+              worker(&TShard::Run, this) {}
+
+    ~TShard() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    void Submit(const TRequest &request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(request);
+        }
+        cv.notify_one();
+    }
+};
+
+struct TConnection {
+    int fd;
+    std::string input;
+    std::string output;
+    unsigned long long nextSeq;
+    unsigned long long nextToSend;
+    // seq -> (shard answers still missing, response text)
+    std::map<unsigned long long, std::pair<size_t, std::string>> pending;
+    bool closing;
+    unsigned int events;
+};
+
+volatile std::sig_atomic_t serverStopping = 0;
+
+void ServerSignal(int) {
+    serverStopping = 1;
+}
+
+// Serves the stdin protocol, one command per line, on a Unix domain socket.
+// Keys are spread over the shards by hash; Save and Load go to every shard.
+// Each shard saves its own part FILE.<shard> and loads the keys it owns from
+// all parts, so the shard count may change between runs. Every shard queues
+// the broadcasts in the same order, so their barriers cannot deadlock.
+// Responses are returned in request order per connection.
+class TServer {
+private:
+    int listenFd;
+    int epollFd;
+    TCompletionQueue completions;
+    std::vector<std::unique_ptr<TShard>> shards;
+    std::unordered_map<unsigned long long, TConnection> connections;
+    unsigned long long nextConnection;
+
+    // Stops reading once the peer has hung up, so that a half-closed socket
+    // does not spin the loop while its last answers are pending.
+    void Watch(unsigned long long id, TConnection &conn) {
+        unsigned int events = (conn.closing ? 0u : (unsigned int) (EPOLLIN | EPOLLRDHUP))
+                | (conn.output.empty() ? 0u : (unsigned int) EPOLLOUT);
+        if (events == conn.events) {
+            return;
+        }
+        conn.events = events;
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+
+    void Close(unsigned long long id) {
+        auto it = connections.find(id);
+        if (it != connections.end()) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+            close(it->second.fd);
+            connections.erase(it);
+        }
+    }
+
+    void Accept() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            unsigned long long id = nextConnection++;
+            connections[id] = TConnection{fd, "", "", 0, 0, {}, false, EPOLLIN | EPOLLRDHUP};
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = id;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    void Dispatch(unsigned long long id, TConnection &conn, const std::string &line) {
+        std::vector<std::string> tokens;
+        std::string token;
+        for (char c: line) {
+            if (c == ' ' || c == '\t' || c == '\r') {
+                if (!token.empty()) {
+                    tokens.emplace_back(token);
+                    token.clear();
+                }
+            } else {
+                token.push_back(c);
+            }
+        }
+        if (!token.empty()) {
+            tokens.emplace_back(token);
+        }
+        if (tokens.empty()) {
+            return;
+        }
+
+        TRequest request;
+        request.connection = id;
+        request.value = 0;
+        if (tokens[0] == "!") {
+            if (tokens.size() < 3 || (tokens[1] != "Save" && tokens[1] != "Load")) {
+                return;
+            }
+            request.type = tokens[1][0];
+            request.fileName = tokens[2];
+            request.seq = conn.nextSeq++;
+            request.barrier = std::make_shared<TBarrier>(shards.size());
+            conn.pending[request.seq] = {shards.size(), ""};
+            for (auto &shard: shards) {
+                shard->Submit(request);
+            }
+            return;
+        }
+        if (tokens[0] == "+" && tokens.size() >= 3) {
+            request.type = '+';
+            request.key = TString(tokens[1].c_str());
+            request.value = strtoull(tokens[2].c_str(), nullptr, 10);
+        } else if (tokens[0] == "-" && tokens.size() >= 2) {
+            request.type = '-';
+            request.key = TString(tokens[1].c_str());
+        } else {
+            request.type = '?';
+            request.key = TString(tokens[0].c_str());
+        }
+        ToLower(request.key);
+        request.seq = conn.nextSeq++;
+        conn.pending[request.seq] = {1, ""};
+        shards[HashKey(request.key) % shards.size()]->Submit(request);
+    }
+
+    void Read(unsigned long long id, TConnection &conn) {
+        char buffer[READ_CHUNK_SIZE];
+        while (true) {
+            ssize_t got = read(conn.fd, buffer, sizeof(buffer));
+            if (got > 0) {
+                conn.input.append(buffer, (size_t) got);
+                continue;
+            }
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                conn.closing = true;
+            }
+            break;
+        }
+        size_t start = 0;
+        size_t end;
+        while ((end = conn.input.find('\n', start)) != std::string::npos) {
+            Dispatch(id, conn, conn.input.substr(start, end - start));
+            start = end + 1;
+        }
+        conn.input.erase(0, start);
+        if (conn.closing && !conn.input.empty()) {
+            Dispatch(id, conn, conn.input);
+            conn.input.clear();
+        }
+    }
+
+    // Moves finished responses to the output in request order and writes as
+    // much as the socket takes. Returns false once the connection is closed.
+    bool Flush(unsigned long long id, TConnection &conn) {
+        auto it = conn.pending.begin();
+        while (it != conn.pending.end() && it->first == conn.nextToSend && it->second.first == 0) {
+            conn.output += it->second.second;
+            ++conn.nextToSend;
+            it = conn.pending.erase(it);
+        }
+        while (!conn.output.empty()) {
+            ssize_t sent = send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                Close(id);
+                return false;
+            }
+            conn.output.erase(0, (size_t) sent);
+        }
+        if (conn.closing && conn.pending.empty() && conn.output.empty()) {
+            Close(id);
+            return false;
+        }
+        Watch(id, conn);
+        return true;
+    }
+
+    void Complete() {
+        std::vector<TResponse> responses;
+        completions.Drain(responses);
+        std::vector<unsigned long long> touched;
+        for (auto &response: responses) {
+            auto conn = connections.find(response.connection);
+            if (conn == connections.end()) {
+                continue;
+            }
+            auto &part = conn->second.pending[response.seq];
+            if (part.second.empty() || response.text != "OK\n") {
+                part.second = std::move(response.text);
+            }
+            --part.first;
+            touched.push_back(response.connection);
+        }
+        for (auto id: touched) {
+            auto conn = connections.find(id);
+            if (conn != connections.end()) {
+                Flush(id, conn->second);
+            }
+        }
+    }
+
+public:
+    TServer(size_t shardCount, const TCacheConfig &config) : listenFd(-1), epollFd(-1), nextConnection(2) {
+        for (size_t i = 0; i < shardCount; ++i) {
+            shards.emplace_back(new TShard(i, shardCount, completions, config));
+        }
+    }
+
+    ~TServer() {
+        for (auto &conn: connections) {
+            close(conn.second.fd);
+        }
+        if (epollFd >= 0) {
+            close(epollFd);
+        }
+        if (listenFd >= 0) {
+            close(listenFd);
+        }
+    }
+
+    bool Listen(const char *path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        strcpy(addr.sun_path, path);
+        unlink(path);
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(listenFd, SERVER_BACKLOG) < 0) {
+            return false;
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_EVENT_ID;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.data.u64 = COMPLETION_EVENT_ID;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, completions.Fd(), &ev);
+        return true;
+    }
+
+    void Run() {
+        epoll_event events[MAX_EVENTS];
+        while (!serverStopping) {
+            int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            STAT_POLL();
+            for (int i = 0; i < n; ++i) {
+                unsigned long long id = events[i].data.u64;
+                if (id == LISTEN_EVENT_ID) {
+                    Accept();
+                    continue;
+                }
+                if (id == COMPLETION_EVENT_ID) {
+                    Complete();
+                    continue;
+                }
+                auto it = connections.find(id);
+                if (it == connections.end()) {
+                    continue;
+                }
+                if (events[i].events & EPOLLERR) {
+                    Close(id);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                    Read(id, it->second);
+                }
+                Flush(id, it->second);
+            }
+        }
+    }
+};
+
+int RunServer(const char *path, size_t shardCount, const TCacheConfig &config) {
+    struct sigaction action{};
+    action.sa_handler = ServerSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // Shard threads inherit a blocked mask, so signals interrupt epoll_wait
+    // in the main thread.
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    TServer server(shardCount, config);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (!server.Listen(path)) {
+        std::cerr << "Cannot listen on " << path << '\n';
+        return 1;
+    }
+    server.Run();
+    unlink(path);
+    return 0;
+}
+
+// Usage: lab2 [--server PATH [--shards N]] [--cache N [--cache-admit always|second]]
+// Without --server commands are read from stdin. --cache N puts an N entry
+// hot-key cache in front of lookups (per shard in server mode); by default a
+// key is cached on its second lookup.
+int main(int argc, char *argv[]) {
     std::ios_base::sync_with_stdio(false);
     std::cin.tie(0);
     std::cout.tie(0);
+    STAT_INIT();
+
+    const char *socketPath = nullptr;
+    size_t shardCount = std::thread::hardware_concurrency();
+    TCacheConfig cacheConfig = {0, true};
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], "--server") == 0) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--shards") == 0) {
+            shardCount = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            cacheConfig.size = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--cache-admit") == 0) {
+            cacheConfig.secondHit = strcmp(argv[++i], "always") != 0;
+        }
+    }
+    if (socketPath != nullptr) {
+        int result = RunServer(socketPath, shardCount == 0 ? 1 : shardCount, cacheConfig);
+        STAT_DUMP();
+        return result;
+    }
 
-    TAVLTree<TString, unsigned long long> tree;
+    TDictionary tree(cacheConfig);
     TString command;
     TString key;
     TString fileName;
     unsigned long long value;
 
     while (true) {
+        STAT_POLL();
         std::cin >> std::ws;
         if (std::cin.eof()) {
             break;
         }
-        std::cin >> command;
+        STAT_ADD(STAT_COMMANDS, 1);
+        {
+            STAT_TIMER(STAT_PARSE_NS);
+            std::cin >> command;
+        }
         if (command == "+") {
             std::cin >> key >> value;
             ToLower(key);
+            STAT_ADD(STAT_INSERTS, 1);
+            STAT_TIMER(STAT_INSERT_NS);
             if (tree.Insert(key, value)) {
                 std::cout << "OK" << '\n';
             } else {
@@ -471,6 +1646,8 @@ int main() {
         } else if (command == "-") {
             std::cin >> key;
             ToLower(key);
+            STAT_ADD(STAT_REMOVES, 1);
+            STAT_TIMER(STAT_REMOVE_NS);
             if (tree.Remove(key)) {
                 std::cout << "OK" << '\n';
             } else {
@@ -481,16 +1658,22 @@ int main() {
             if (key == "Save") {
                 std::cin >> fileName;
                 std::ofstream ofs(fileName.GetData(), std::ios::binary | std::ios::out);
+                STAT_TIMER(STAT_SAVE_NS);
                 tree.Save(ofs);
                 std::cout << "OK" << '\n';
             } else if (key == "Load") {
                 std::cin >> fileName;
-                std::ifstream ifs(fileName.GetData(), std::ios::binary | std::ios::in);
-                tree.Load(ifs);
-                std::cout << "OK" << '\n';
+                STAT_TIMER(STAT_LOAD_NS);
+                if (tree.Load(fileName.GetData(), 0, 1)) {
+                    std::cout << "OK" << '\n';
+                } else {
+                    std::cout << "LoadError" << '\n';
+                }
             }
         } else {
             ToLower(command);
+            STAT_ADD(STAT_LOOKUPS, 1);
+            STAT_TIMER(STAT_FIND_NS);
             unsigned long long *tmpValue;
             if ((tmpValue = tree.Find(command)) != nullptr) {
                 std::cout << "OK: " << *tmpValue << '\n';
@@ -499,6 +1682,7 @@ int main() {
             }
         }
     }
+    STAT_DUMP();
 
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,136 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <unordered_map>
 
 const unsigned short MAX_WORD_SIZE = 17;
 const unsigned short ALPHABET_SIZE = 26;
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+const size_t MAX_FUZZY_PATTERN_SIZE = 64;
+const char INDEX_MAGIC[4] = {'L', '4', 'I', 'X'};
+
+#ifdef DA_STATS
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+
+// Phase timers and matcher counters, compiled in with -DDA_STATS. Phase
+// timers are exclusive: one started inside another pauses it, so a flush
+// from inside the search counts as output only, and the phases add up to
+// total_ns. The values go to stderr at exit or on SIGUSR1, as JSON or
+// Prometheus text (DA_STATS_FORMAT=prometheus).
+enum EStat {
+    STAT_TOTAL_NS,
+    STAT_PARSE_NS,
+    STAT_SEARCH_NS,
+    STAT_OUTPUT_NS,
+    STAT_INDEX_BUILD_NS,
+    STAT_WORDS,
+    STAT_WORD_COMPARISONS,
+    STAT_SHIFTS,
+    STAT_MATCHES,
+    STAT_OUTPUT_BYTES,
+    STAT_FLUSHES,
+    STAT_COUNT
+};
+
+const char *STAT_NAMES[STAT_COUNT] = {
+    "total_ns",
+    "parse_ns",
+    "search_ns",
+    "output_ns",
+    "index_build_ns",
+    "words",
+    "word_comparisons",
+    "shifts",
+    "matches",
+    "output_bytes",
+    "flushes"
+};
+
+unsigned long long statValues[STAT_COUNT];
+volatile std::sig_atomic_t statDumpRequested = 0;
+
+void StatDump() {
+    const char *format = getenv("DA_STATS_FORMAT");
+    if (format != nullptr && strcmp(format, "prometheus") == 0) {
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << "# TYPE lab4_" << STAT_NAMES[i] << " counter\n";
+            std::cerr << "lab4_" << STAT_NAMES[i] << ' ' << statValues[i] << '\n';
+        }
+    } else {
+        std::cerr << '{';
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            std::cerr << (i > 0 ? ", " : "") << '"' << STAT_NAMES[i] << "\": " << statValues[i];
+        }
+        std::cerr << "}\n";
+    }
+    std::cerr.flush();
+}
+
+void StatSignal(int) {
+    statDumpRequested = 1;
+}
+
+class TStatTimer {
+private:
+    EStat stat;
+    bool exclusive;
+    TStatTimer *outer;
+    std::chrono::steady_clock::time_point start;
+
+    static TStatTimer *current;
+
+    void Stop(std::chrono::steady_clock::time_point now) {
+        statValues[stat] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    }
+
+public:
+    TStatTimer(EStat s, bool phase = true)
+            : stat(s), exclusive(phase), outer(nullptr), start(std::chrono::steady_clock::now()) {
+        if (exclusive) {
+            outer = current;
+            if (outer != nullptr) {
+                outer->Stop(start);
+            }
+            current = this;
+        }
+    }
+
+    ~TStatTimer() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        Stop(now);
+        if (exclusive) {
+            current = outer;
+            if (outer != nullptr) {
+                outer->start = now;
+            }
+        }
+    }
+};
+
+TStatTimer *TStatTimer::current = nullptr;
+
+#define STAT_ADD(stat, n) (statValues[stat] += (n))
+#define STAT_TIMER(stat) TStatTimer statTimer##stat(stat)
+#define STAT_TOTAL_TIMER(stat) TStatTimer statTimer##stat(stat, false)
+#define STAT_INIT() std::signal(SIGUSR1, StatSignal)
+#define STAT_POLL() do { if (statDumpRequested) { statDumpRequested = 0; StatDump(); } } while (0)
+#define STAT_DUMP() StatDump()
+#else
+#define STAT_ADD(stat, n) ((void) 0)
+#define STAT_TIMER(stat) ((void) 0)
+#define STAT_TOTAL_TIMER(stat) ((void) 0)
+#define STAT_INIT() ((void) 0)
+#define STAT_POLL() ((void) 0)
+#define STAT_DUMP() ((void) 0)
+#endif
 
 struct TWord {
     TWord();
@@ -40,6 +168,85 @@ inline void Clear(TWord &word) {
     word.size = 0;
 }
 
+// Collects matches in a fixed buffer and writes it out in large chunks.
+// In binary mode every match is two little-endian uint32: stringID, wordID.
+class TMatchSink {
+private:
+    char buffer[OUTPUT_BUFFER_SIZE];
+    size_t size;
+    bool binary;
+
+    void Reserve(size_t n) {
+        if (size + n > OUTPUT_BUFFER_SIZE) {
+            Flush();
+        }
+    }
+
+    void AppendUInt(unsigned int x) {
+        char digits[10];
+        int len = 0;
+        do {
+            digits[len++] = (char) ('0' + x % 10);
+            x /= 10;
+        } while (x > 0);
+        while (len > 0) {
+            buffer[size++] = digits[--len];
+        }
+    }
+
+    void AppendRaw(unsigned int x) {
+        for (int i = 0; i < 4; ++i) {
+            buffer[size++] = (char) ((x >> (8 * i)) & 0xFF);
+        }
+    }
+
+public:
+    TMatchSink(bool binaryMode) : size(0), binary(binaryMode) {}
+
+    ~TMatchSink() {
+        Flush();
+    }
+
+    void Push(unsigned int stringID, unsigned int wordID) {
+        STAT_ADD(STAT_MATCHES, 1);
+        if (binary) {
+            Reserve(8);
+            AppendRaw(stringID);
+            AppendRaw(wordID);
+        } else {
+            Reserve(23);
+            AppendUInt(stringID);
+            buffer[size++] = ',';
+            buffer[size++] = ' ';
+            AppendUInt(wordID);
+            buffer[size++] = '\n';
+        }
+    }
+
+    // Marks the end of one query's matches: an empty line or a (0, 0) pair.
+    void EndQuery() {
+        if (binary) {
+            Reserve(8);
+            AppendRaw(0);
+            AppendRaw(0);
+        } else {
+            Reserve(1);
+            buffer[size++] = '\n';
+        }
+    }
+
+    void Flush() {
+        STAT_TIMER(STAT_OUTPUT_NS);
+        if (size > 0) {
+            STAT_ADD(STAT_FLUSHES, 1);
+            STAT_ADD(STAT_OUTPUT_BYTES, size);
+            std::cout.write(buffer, (std::streamsize) size);
+            size = 0;
+        }
+        std::cout.flush();
+    }
+};
+
 std::vector<int> ZFunction(const std::vector<TWord> &str) {
     int n = (int) str.size();
     std::vector<int> z(n);
@@ -69,7 +276,9 @@ std::vector<int> SPFunction(const std::vector<TWord> &str) {
     return sp;
 }
 
-void KMP(const std::vector<TWord> &pattern, const std::vector<TWord> &text, const std::vector<int> &sp, int &start) {
+void KMP(const std::vector<TWord> &pattern, const std::vector<TWord> &text, const std::vector<int> &sp, int &start,
+         TMatchSink &sink) {
+    STAT_TIMER(STAT_SEARCH_NS);
     size_t m = pattern.size();
     size_t n = text.size();
     if (m > n) {
@@ -81,9 +290,11 @@ void KMP(const std::vector<TWord> &pattern, const std::vector<TWord> &text, cons
         while (j < m && text[i + j] == pattern[j]) {
             ++j;
         }
+        STAT_ADD(STAT_WORD_COMPARISONS, j < m ? j + 1 : j);
         if (j == m) {
-            std::cout << text[i].stringID << ", " << text[i].wordID << "\n";
+            sink.Push(text[i].stringID, text[i].wordID);
         } else if (j > 0 && j > sp[j - 1] + 1) {
+            STAT_ADD(STAT_SHIFTS, 1);
             i = i + j - sp[j - 1] - 1;
         }
         ++i;
@@ -91,11 +302,406 @@ void KMP(const std::vector<TWord> &pattern, const std::vector<TWord> &text, cons
     start = i - m;
 }
 
-int main() {
-    std::ios_base::sync_with_stdio(false);
-    std::cin.tie(nullptr);
-    std::cout.tie(nullptr);
+void SplitWords(const std::string &line, std::vector<std::string> &words) {
+    words.clear();
+    std::string current;
+    for (auto &c: line) {
+        if (c == ' ' || c == '\t') {
+            if (!current.empty()) {
+                words.emplace_back(current);
+                current.clear();
+            }
+        } else {
+            current.push_back((char) toupper(c));
+        }
+    }
+    if (!current.empty()) {
+        words.emplace_back(current);
+    }
+}
 
+// Word-level suffix array over a fixed corpus. Words are mapped to dense ids,
+// so a phrase query is a binary search over suffixes compared id by id.
+class TWordIndex {
+private:
+    std::unordered_map<std::string, unsigned int> vocabulary;
+    std::vector<std::string> words;
+    std::vector<unsigned int> tokens;
+    std::vector<unsigned int> stringIDs;
+    std::vector<unsigned int> wordIDs;
+    std::vector<unsigned int> sa;
+
+    unsigned int WordID(const std::string &word) {
+        auto it = vocabulary.find(word);
+        if (it != vocabulary.end()) {
+            return it->second;
+        }
+        unsigned int id = (unsigned int) words.size();
+        vocabulary.emplace(word, id);
+        words.emplace_back(word);
+        return id;
+    }
+
+    // Prefix doubling over cyclic shifts with counting sort, the sentinel 0 is
+    // appended so that cyclic order equals suffix order.
+    void BuildSuffixArray() {
+        size_t n = tokens.size() + 1;
+        size_t classes = std::max(words.size() + 1, n);
+        std::vector<unsigned int> p(n), c(n), pn(n), cn(n), cnt(classes, 0);
+        for (size_t i = 0; i < n; ++i) {
+            c[i] = i + 1 < n ? tokens[i] + 1 : 0;
+            ++cnt[c[i]];
+        }
+        for (size_t i = 1; i < classes; ++i) {
+            cnt[i] += cnt[i - 1];
+        }
+        for (size_t i = n; i > 0; --i) {
+            p[--cnt[c[i - 1]]] = (unsigned int) (i - 1);
+        }
+        for (size_t h = 1; h < n; h <<= 1) {
+            for (size_t i = 0; i < n; ++i) {
+                pn[i] = (unsigned int) ((p[i] + n - h) % n);
+            }
+            std::fill(cnt.begin(), cnt.end(), 0);
+            for (size_t i = 0; i < n; ++i) {
+                ++cnt[c[pn[i]]];
+            }
+            for (size_t i = 1; i < classes; ++i) {
+                cnt[i] += cnt[i - 1];
+            }
+            for (size_t i = n; i > 0; --i) {
+                p[--cnt[c[pn[i - 1]]]] = pn[i - 1];
+            }
+            cn[p[0]] = 0;
+            unsigned int count = 1;
+            for (size_t i = 1; i < n; ++i) {
+                if (c[p[i]] != c[p[i - 1]] || c[(p[i] + h) % n] != c[(p[i - 1] + h) % n]) {
+                    ++count;
+                }
+                cn[p[i]] = count - 1;
+            }
+            c.swap(cn);
+            if (count == n) {
+                break;
+            }
+        }
+        sa.assign(p.begin() + 1, p.end());
+    }
+
+    // Compares the first m words of the suffix at pos with the pattern.
+    int Compare(unsigned int pos, const std::vector<unsigned int> &pattern) const {
+        size_t n = tokens.size();
+        for (size_t j = 0; j < pattern.size(); ++j) {
+            if (pos + j >= n) {
+                return -1;
+            }
+            if (tokens[pos + j] != pattern[j]) {
+                return tokens[pos + j] < pattern[j] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    // Checks that the next bytes are inside the file before anything is
+    // allocated from a size read out of it.
+    static bool Fits(std::ifstream &ifs, size_t fileSize, size_t bytes) {
+        std::streamoff pos = ifs.tellg();
+        return pos >= 0 && bytes <= fileSize - (size_t) pos;
+    }
+
+    template <typename T>
+    static void WriteVector(std::ofstream &ofs, const std::vector<T> &vec) {
+        unsigned int size = (unsigned int) vec.size();
+        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        ofs.write(reinterpret_cast<const char *>(vec.data()), (std::streamsize) (sizeof(T) * vec.size()));
+    }
+
+    template <typename T>
+    static bool ReadVector(std::ifstream &ifs, std::vector<T> &vec, size_t fileSize) {
+        unsigned int size = 0;
+        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+        if (!ifs || !Fits(ifs, fileSize, sizeof(T) * size)) {
+            return false;
+        }
+        vec.resize(size);
+        ifs.read(reinterpret_cast<char *>(vec.data()), (std::streamsize) (sizeof(T) * size));
+        return (bool) ifs;
+    }
+
+public:
+    void Build(std::istream &is) {
+        STAT_TIMER(STAT_PARSE_NS);
+        std::string buffer;
+        std::vector<std::string> line;
+        unsigned int stringID = 1;
+        while (getline(is, buffer)) {
+            SplitWords(buffer, line);
+            for (size_t i = 0; i < line.size(); ++i) {
+                tokens.push_back(WordID(line[i]));
+                stringIDs.push_back(stringID);
+                wordIDs.push_back((unsigned int) i + 1);
+            }
+            ++stringID;
+        }
+        STAT_ADD(STAT_WORDS, tokens.size());
+        STAT_TIMER(STAT_INDEX_BUILD_NS);
+        BuildSuffixArray();
+    }
+
+    void Save(std::ofstream &ofs) const {
+        ofs.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        unsigned int vocabularySize = (unsigned int) words.size();
+        ofs.write(reinterpret_cast<const char *>(&vocabularySize), sizeof(vocabularySize));
+        for (auto &word: words) {
+            unsigned int size = (unsigned int) word.size();
+            ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            ofs.write(word.data(), size);
+        }
+        WriteVector(ofs, tokens);
+        WriteVector(ofs, stringIDs);
+        WriteVector(ofs, wordIDs);
+        WriteVector(ofs, sa);
+    }
+
+    // Rejects truncated or inconsistent files, so Query never reads past the
+    // position arrays.
+    bool Load(std::ifstream &ifs) {
+        if (!ifs.seekg(0, std::ios::end)) {
+            return false;
+        }
+        size_t fileSize = (size_t) ifs.tellg();
+        ifs.seekg(0);
+        char magic[sizeof(INDEX_MAGIC)];
+        ifs.read(magic, sizeof(magic));
+        if (!ifs || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) {
+            return false;
+        }
+        unsigned int vocabularySize = 0;
+        ifs.read(reinterpret_cast<char *>(&vocabularySize), sizeof(vocabularySize));
+        if (!ifs || !Fits(ifs, fileSize, (size_t) vocabularySize * sizeof(unsigned int))) {
+            return false;
+        }
+        words.resize(vocabularySize);
+        vocabulary.clear();
+        for (unsigned int i = 0; i < vocabularySize; ++i) {
+            unsigned int size = 0;
+            ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+            if (!ifs || !Fits(ifs, fileSize, size)) {
+                return false;
+            }
+            words[i].resize(size);
+            ifs.read(&words[i][0], size);
+            vocabulary.emplace(words[i], i);
+        }
+        if (!ReadVector(ifs, tokens, fileSize) || !ReadVector(ifs, stringIDs, fileSize) ||
+            !ReadVector(ifs, wordIDs, fileSize) || !ReadVector(ifs, sa, fileSize)) {
+            return false;
+        }
+        size_t n = tokens.size();
+        if (stringIDs.size() != n || wordIDs.size() != n || sa.size() != n) {
+            return false;
+        }
+        for (auto pos: sa) {
+            if (pos >= n) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Query(const std::vector<std::string> &pattern, TMatchSink &sink) const {
+        STAT_TIMER(STAT_SEARCH_NS);
+        std::vector<unsigned int> ids;
+        for (auto &word: pattern) {
+            auto it = vocabulary.find(word);
+            if (it == vocabulary.end()) {
+                return;
+            }
+            ids.push_back(it->second);
+        }
+        if (ids.empty()) {
+            return;
+        }
+        size_t lo = 0, hi = sa.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            STAT_ADD(STAT_WORD_COMPARISONS, 1);
+            if (Compare(sa[mid], ids) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        size_t first = lo;
+        hi = sa.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            STAT_ADD(STAT_WORD_COMPARISONS, 1);
+            if (Compare(sa[mid], ids) <= 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        std::vector<unsigned int> positions(sa.begin() + first, sa.begin() + lo);
+        std::sort(positions.begin(), positions.end());
+        for (auto pos: positions) {
+            sink.Push(stringIDs[pos], wordIDs[pos]);
+        }
+    }
+};
+
+int BuildIndex(const char *fileName) {
+    TWordIndex index;
+    index.Build(std::cin);
+    std::ofstream ofs(fileName, std::ios::binary | std::ios::out);
+    if (!ofs) {
+        std::cerr << "Cannot open " << fileName << "\n";
+        return 1;
+    }
+    index.Save(ofs);
+    return 0;
+}
+
+int QueryIndex(const char *fileName, TMatchSink &sink) {
+    TWordIndex index;
+    std::ifstream ifs(fileName, std::ios::binary | std::ios::in);
+    if (!index.Load(ifs)) {
+        std::cerr << "Cannot load index " << fileName << "\n";
+        return 1;
+    }
+    STAT_TIMER(STAT_PARSE_NS);
+    std::string buffer;
+    std::vector<std::string> pattern;
+    while (getline(std::cin, buffer)) {
+        STAT_POLL();
+        SplitWords(buffer, pattern);
+        index.Query(pattern, sink);
+        sink.EndQuery();
+    }
+    return 0;
+}
+
+void ParseWords(const std::string &line, unsigned int stringID, std::vector<TWord> &words) {
+    words.clear();
+    TWord current;
+    current.stringID = stringID;
+    current.wordID = 1;
+    unsigned short ind = 0;
+    for (auto &c: line) {
+        if (c == ' ' || c == '\t') {
+            if (ind > 0) {
+                words.emplace_back(current);
+                ++current.wordID;
+                Clear(current);
+                ind = 0;
+            }
+        } else {
+            char upper = (char) toupper(c);
+            if (ind < MAX_WORD_SIZE) {
+                current.word[ind] = upper;
+            }
+            current.hash = current.hash * ALPHABET_SIZE + upper - 'A';
+            ++ind;
+        }
+    }
+    if (ind > 0) {
+        words.emplace_back(current);
+    }
+}
+
+// Bit-parallel approximate phrase search (Shift-And with Wu-Manber error
+// levels) over word tokens. Bit i of state[d] is set when the first i + 1
+// pattern words match the text ending at the current word with at most d
+// errors. Mismatch mode counts substituted words only, difference mode also
+// counts missing and extra words.
+class TFuzzyMatcher {
+private:
+    std::unordered_map<unsigned int, unsigned long long> masks;
+    std::vector<unsigned long long> state;
+    unsigned int positions[MAX_FUZZY_PATTERN_SIZE][2];
+    unsigned long long last;
+    size_t m;
+    size_t seen;
+    bool differences;
+
+public:
+    // More than m errors match the same windows as m errors, so k is clamped
+    // to the pattern length.
+    TFuzzyMatcher(const std::vector<TWord> &pattern, int k, bool indels)
+            : state(std::min((size_t) k, pattern.size()) + 1, 0), last(1ull << (pattern.size() - 1)),
+              m(pattern.size()), seen(0), differences(indels) {
+        for (size_t i = 0; i < m; ++i) {
+            masks[pattern[i].hash] |= 1ull << i;
+        }
+        if (differences) {
+            for (size_t d = 1; d < state.size() && d < 64; ++d) {
+                state[d] = (1ull << d) - 1;
+            }
+        }
+    }
+
+    // Mismatch mode reports where the window starts, like the exact search;
+    // in difference mode the length varies, so the last word is reported.
+    void Feed(const TWord &word, TMatchSink &sink) {
+        auto it = masks.find(word.hash);
+        unsigned long long mask = it == masks.end() ? 0 : it->second;
+        unsigned long long prev = state[0];
+        state[0] = ((state[0] << 1) | 1) & mask;
+        for (size_t d = 1; d < state.size(); ++d) {
+            unsigned long long cur = state[d];
+            state[d] = (((cur << 1) | 1) & mask) | (prev << 1) | 1;
+            if (differences) {
+                state[d] |= (state[d - 1] << 1) | prev;
+            }
+            prev = cur;
+        }
+        positions[seen % MAX_FUZZY_PATTERN_SIZE][0] = word.stringID;
+        positions[seen % MAX_FUZZY_PATTERN_SIZE][1] = word.wordID;
+        ++seen;
+        if ((state.back() & last) == 0) {
+            return;
+        }
+        if (differences) {
+            sink.Push(word.stringID, word.wordID);
+        } else if (seen >= m) {
+            size_t first = (seen - m) % MAX_FUZZY_PATTERN_SIZE;
+            sink.Push(positions[first][0], positions[first][1]);
+        }
+    }
+};
+
+int FuzzySearch(int k, bool indels, TMatchSink &sink) {
+    STAT_TIMER(STAT_PARSE_NS);
+    std::string buffer;
+    std::vector<TWord> pattern;
+    std::vector<TWord> words;
+    getline(std::cin, buffer);
+    ParseWords(buffer, 0, pattern);
+    if (pattern.empty()) {
+        return 0;
+    }
+    if (pattern.size() > MAX_FUZZY_PATTERN_SIZE) {
+        std::cerr << "Pattern is longer than " << MAX_FUZZY_PATTERN_SIZE << " words\n";
+        return 1;
+    }
+    TFuzzyMatcher matcher(pattern, k, indels);
+    unsigned int stringID = 1;
+    while (getline(std::cin, buffer)) {
+        ParseWords(buffer, stringID, words);
+        STAT_ADD(STAT_WORDS, words.size());
+        STAT_POLL();
+        STAT_TIMER(STAT_SEARCH_NS);
+        for (auto &word: words) {
+            matcher.Feed(word, sink);
+        }
+        ++stringID;
+    }
+    return 0;
+}
+
+int ExactSearch(TMatchSink &sink) {
+    STAT_TIMER(STAT_PARSE_NS);
     std::vector<TWord> pattern;
     std::vector<TWord> text;
     int start = 0;
@@ -133,8 +739,9 @@ int main() {
             if (c == '\t' || c == ' ') {
                 if (ind > 0) {
                     text.emplace_back(current);
+                    STAT_ADD(STAT_WORDS, 1);
                     if (text.size() > 2 * pattern.size()) {
-                        KMP(pattern, text, sp, start);
+                        KMP(pattern, text, sp, start, sink);
                         text.erase(text.begin(), text.begin() + (int) pattern.size());
                         text.reserve(2 * text.size());
                     }
@@ -150,8 +757,9 @@ int main() {
         }
         if (ind > 0) {
             text.emplace_back(current);
+            STAT_ADD(STAT_WORDS, 1);
             if (text.size() > 2 * pattern.size()) {
-                KMP(pattern, text, sp, start);
+                KMP(pattern, text, sp, start, sink);
                 text.erase(text.begin(), text.begin() + (int) pattern.size());
                 text.reserve(2 * text.size());
             }
@@ -160,11 +768,75 @@ int main() {
         ++current.stringID;
         Clear(current);
         ind = 0;
+        STAT_POLL();
     }
     if (ind > 0) {
         text.emplace_back(current);
     }
-    KMP(pattern, text, sp, start);
+    KMP(pattern, text, sp, start, sink);
 
     return 0;
-}
\ No newline at end of file
+}
+
+bool ParseErrors(const char *str, int &errors) {
+    char *end = nullptr;
+    errno = 0;
+    long value = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || errno != 0 || value < 0 || value > INT_MAX) {
+        return false;
+    }
+    errors = (int) value;
+    return true;
+}
+
+// Usage: lab4 [-b] [--build-index FILE | --query FILE | -k K | -d K]
+// Without a mode the first input line is the pattern and the rest is the text.
+// --build-index reads the corpus from stdin and saves its index to FILE,
+// --query reads one pattern per line and prints its matches followed by an
+// empty line (a (0, 0) pair in binary mode).
+// -k K allows up to K substituted words, -d K also missing or extra words;
+// the pattern is then limited to MAX_FUZZY_PATTERN_SIZE words.
+int main(int argc, char *argv[]) {
+    std::ios_base::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+    std::cout.tie(nullptr);
+    STAT_INIT();
+
+    bool binary = false;
+    const char *buildFile = nullptr;
+    const char *queryFile = nullptr;
+    int errors = -1;
+    bool indels = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--binary") == 0) {
+            binary = true;
+        } else if (strcmp(argv[i], "--build-index") == 0 && i + 1 < argc) {
+            buildFile = argv[++i];
+        } else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) {
+            queryFile = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-d") == 0) {
+            indels = argv[i][1] == 'd';
+            if (i + 1 >= argc || !ParseErrors(argv[i + 1], errors)) {
+                std::cerr << "Usage: " << argv[0] << " " << argv[i] << " K, K is a non-negative integer\n";
+                return 1;
+            }
+            ++i;
+        }
+    }
+    int result = 0;
+    {
+        STAT_TOTAL_TIMER(STAT_TOTAL_NS);
+        TMatchSink sink(binary);
+        if (buildFile != nullptr) {
+            result = BuildIndex(buildFile);
+        } else if (queryFile != nullptr) {
+            result = QueryIndex(queryFile, sink);
+        } else if (errors >= 0) {
+            result = FuzzySearch(errors, indels, sink);
+        } else {
+            result = ExactSearch(sink);
+        }
+    }
+    STAT_DUMP();
+    return result;
+}